@@ -2,7 +2,9 @@
  * @file    mygame.c
  * @Author  Gareth Sharpe
  * @date    February 14, 2018
- * @usage   gcc -o mygame mygame.c -lncurses 
+ * @usage   gcc -o mygame mygame.c -lncurses -lpthread
+ *          ./mygame [--bench] [--telemetry file.csv] [--renderer curses|ansi]
+ *                   [--scores file]
  * @brief   A simple flight simulator game.
  * 
  */
@@ -14,6 +16,16 @@
 #include <signal.h>
 #include <time.h>
 #include <sys/time.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 
 #define DELAY       35000
 #define PLANEWIDTH  16
@@ -21,52 +33,327 @@
 #define MAGSIZE     10
 #define ENEMIES     8   
 #define MAXHEALTH   10
-#define FRIENDLY    TRUE
 #define SHOTGUN     5
 #define MINALRM     1
 #define MAXALRM     6
+#define SIMRATE     12
+#define FRAMERATE   60
+#define SIMSTEP     (1000000 / SIMRATE)
+#define FRAMESTEP   (1000000 / FRAMERATE)
+#define MAXCATCHUP  4
+#define KEYQUEUE    16
+#define FIXSHIFT    8
+#define FIXONE      (1 << FIXSHIFT)
+#define PLANESPEEDX (3 * FIXONE)
+#define PLANESPEEDY FIXONE
+#define BULLETSPEED FIXONE
+#define ENEMYSPEED  FIXONE
+#define BENCHFRAMES 600
+#define RINGSIZE    1024
+#define DRAINDELAY  20000
+#define DEGRADEAFTER  30
+#define RESTOREAFTER  180
+#define HEADROOM      50
+#define CULLRANGE     TO_FIXED(12)
+#define GOVERNORLOG   64
+#define ANSICELL      16
+#define ANSIEXTRA     64
+#define ANSIGAP       3
+#define ANSIERASE     5
+#define LEADERS       5
+#define SCORESFILE    ".mygame_scores"
+#define SCOREVERSION  1
+#define LOGMAGIC      "mglog01"
+#define INDEXMAGIC    "mgidx01"
+
+/**
+* Quality Levels
+* each level keeps the savings of the ones before it.
+*/
+#define QUALITY_FULL    0
+#define QUALITY_SKIP    1
+#define QUALITY_STATIC  2
+#define QUALITY_CULL    3
+#define QUALITY_BORDER  4
+
+/**
+* Palette Entries
+* every frame cell carries one of these, mapped to
+* a curses attribute by the palette table.
+*/
+#define ATTR_NONE     0
+#define ATTR_PLAYER   1
+#define ATTR_ENEMY    2
+#define ATTR_FBULLET  3
+#define ATTR_EBULLET  4
+#define ATTR_HEALTH   5
+#define ATTR_MAG      6
+#define ATTR_BORDER   7
+#define ATTRS         8
+
+/**
+* Fixed Point Helpers
+* positions and velocities are stored in 1/FIXONE
+* fractions of a terminal cell.
+*/
+#define TO_FIXED(n) ((n) * FIXONE)
+#define TO_CELL(f)  (((f) + FIXONE / 2) >> FIXSHIFT)
+
+/**
+* Components
+* an entity's archetype is the set of these it has. The
+* tags carry no data, only change how systems treat it.
+*/
+#define C_POSITION    (1 << 0)
+#define C_VELOCITY    (1 << 1)
+#define C_SPRITE      (1 << 2)
+#define C_HITBOX      (1 << 3)
+#define C_HEALTH      (1 << 4)
+#define C_GUN         (1 << 5)
+#define C_WANDER      (1 << 6)
+#define C_PROJECTILE  (1 << 7)
+#define C_FRIENDLY    (1 << 8)
+#define HAS(a, m)     (((a)->mask & (m)) == (m))
+
+/**
+* Archetypes
+* every entity of a kind lives in the same archetype,
+* listed here in the order they are drawn.
+*/
+#define ARCH_PLAYER   0
+#define ARCH_FBULLET  1
+#define ARCH_EBULLET  2
+#define ARCH_ENEMY    3
+#define ARCHETYPES    4
 
 /**
 * Data Structures
 */
-typedef struct bullet {
-  int x;
-  int y;
-  int dir;
-  int alive;
-  char s;
-} bullet;
-
-typedef struct enemy {
-  char *top;
-  char *cab;
-  char *mid;
-  char *bot;
-  int x;
-  int y;
-  int alive;
-} enemy;
+typedef int fixed;
+
+typedef struct position {
+  fixed x;
+  fixed y;
+  fixed prev_x;
+  fixed prev_y;
+} position;
+
+typedef struct velocity {
+  fixed vx;
+  fixed vy;
+} velocity;
+
+typedef struct sprite {
+  const char *rows[4];
+  int height;
+  int attr;
+} sprite;
+
+typedef struct hitbox {
+  fixed width;
+} hitbox;
+
+typedef struct health {
+  int hp;
+  int damage;
+} health;
+
+typedef struct gun {
+  int trigger;
+  fixed muzzle_x;
+  fixed muzzle_y;
+  fixed spread;
+} gun;
+
+typedef struct archetype {
+  unsigned mask;
+  int count;
+  int capacity;
+  position *position;
+  velocity *velocity;
+  sprite *sprite;
+  hitbox *hitbox;
+  health *health;
+  gun *gun;
+} archetype;
+
+typedef struct world {
+  archetype types[ARCHETYPES];
+  int spawned;
+  int destroyed;
+  int fired;
+  int alarms_seen;
+} world;
+
+typedef struct cell {
+  char ch;
+  char attr;
+} cell;
+
+typedef struct record {
+  long long micros;
+  int tick;
+  int friendly_bullets;
+  int enemy_bullets;
+  int num_enemies;
+  int health;
+  int fired;
+  int hits;
+  int spawned;
+  int frames;
+  int frame_micros;
+  int quality;
+} record;
+
+typedef struct ring {
+  record records[RINGSIZE];
+  _Alignas(64) atomic_uint head;
+  _Alignas(64) atomic_uint tail;
+  atomic_ulong dropped;
+  atomic_int running;
+} ring;
+
+typedef struct change {
+  long long micros;
+  long long average;
+  int from;
+  int to;
+} change;
+
+typedef struct governor {
+  int level;
+  int over;
+  int under;
+  int frame;
+  long long average;
+  int changes;
+  change log[GOVERNORLOG];
+} governor;
+
+typedef struct renderer {
+  const char *name;
+  void (*begin)   ();
+  void (*present) ();
+  void (*end)     ();
+} renderer;
+
+typedef struct score_entry {
+  long long when;
+  int score;
+  int destroyed;
+  int seconds;
+  unsigned check;
+} score_entry;
+
+typedef struct score_key {
+  int score;
+  unsigned entry;
+} score_key;
+
+typedef struct score_log {
+  char magic[8];
+  int entry_size;
+  int version;
+  score_entry entries[];
+} score_log;
+
+typedef struct score_index {
+  char magic[8];
+  long long indexed;
+  long long count;
+  int dirty;
+  score_key keys[];
+} score_index;
+
+typedef struct leaderboard {
+  int log_fd;
+  int index_fd;
+  score_log *log;
+  score_index *index;
+  size_t log_size;
+  size_t index_size;
+  long long entries;
+  long long games;
+} leaderboard;
+
+typedef struct io_usage {
+  long bytes;
+  long writes;
+} io_usage;
 
 /**
 * Function Prototypes
 */
 void    display_splash        ();
-void    display_game_over     ();
+void    display_game_over     (WINDOW *mainwin, int score, leaderboard *board, long rank);
 int     select_plane          ();
-void    init_mag              (bullet *friendly_mag, int friendly);
-void    init_enemies          (enemy *enemies);
-int     update_bullets        (bullet *mag, int bullets, int friendly);
-void    update_enemies        (bullet *friendly_mag, bullet *enemy_mag, enemy *enemies);
-int     update_health         (bullet *enemy_mag, int health, int x, int y);
-void    spawn_enemy           (enemy *e, int x, int y);
-void    shoot_bullet          (bullet *b, int x, int y);
+void    archetype_init        (archetype *a, unsigned mask, int capacity);
+int     archetype_add         (archetype *a);
+void    archetype_remove      (archetype *a, int i);
+void    world_init            (world *w);
+void    world_free            (world *w);
+void    update_world          (world *w);
+void    spawn_player          (world *w, char *top, char *bot, fixed x, fixed y);
+void    spawn_enemy           (world *w, fixed x, fixed y);
+void    shoot_bullet          (archetype *a, fixed x, fixed y);
+int     input_system          (world *w, const int *keys, int n);
+int     input_key             (world *w, int key);
+void    spawn_system          (world *w);
+void    wander_system         (world *w);
+void    movement_system       (world *w);
+void    firing_system         (world *w);
+void    collision_system      (world *w);
+void    health_system         (world *w);
+void    render_system         (world *w, fixed alpha, fixed range);
 void    draw_mag              (int bullets);
 void    draw_health           (int health);
+void    draw_border           (int simple);
+void    render_frame          (world *w, fixed alpha, int quality);
+void    init_palette          (int color);
+void    frame_begin           ();
+void    frame_put             (int y, int x, const char *s, int attr);
+void    frame_flush           ();
+void    curses_begin          ();
+void    curses_present        ();
+void    curses_end            ();
+void    ansi_begin            ();
+void    ansi_present          ();
+void    ansi_end              ();
+char   *ansi_int              (char *out, int n);
+char   *ansi_sgr              (char *out, int fg);
+void    ansi_write            (const char *buf, size_t len);
+renderer *find_renderer       (const char *name);
+void    read_io_usage         (io_usage *u);
+io_usage run_benchmark        (renderer *r, int color, int batching);
+void    print_benchmark       (const char *path, io_usage u);
+int     interpolate           (fixed prev, fixed cur, fixed alpha);
 int     my_random             (int min, int max);
+long long get_micros          ();
+int     telemetry_start       (const char *path);
+void    telemetry_push        (record *r);
+void   *telemetry_drain       (void *arg);
+void    telemetry_stop        ();
+void    governor_init         (governor *g);
+int     governor_render       (governor *g, int ticked);
+long long governor_budget     (int level);
+void    governor_update       (governor *g, long long work_micros, long long micros);
+void    governor_report       (governor *g);
 void    start_timer           ();
 long    stop_timer            ();
 void    alarm_handler         (int signal);
 int     calculate_score       (float time_alive, int enemies_destroyed);
+unsigned score_check          (const score_entry *e);
+int     score_before          (const score_key *a, const score_key *b);
+int     score_compare         (const void *a, const void *b);
+int     leaderboard_open      (leaderboard *b, const char *path);
+int     leaderboard_map       (leaderboard *b);
+int     leaderboard_index     (leaderboard *b);
+int     leaderboard_valid     (leaderboard *b);
+long    leaderboard_record    (leaderboard *b, int score, int destroyed, int seconds);
+long    leaderboard_search    (leaderboard *b, int score);
+long    leaderboard_rank      (leaderboard *b, int score);
+int     leaderboard_top       (leaderboard *b, score_entry *top, int n);
+void    leaderboard_close     (leaderboard *b);
 
 /**
 * Global Variables
@@ -76,29 +363,72 @@ struct timeval start, end;
 
 /**
 * Global Variables
-* maintains enemy state - required to be global
-* to be used with timer handler.
+* maintains the alarms that have gone off - required
+* to be global to be used with timer handler.
+*/
+volatile sig_atomic_t alarms = 0;
+int alarm_delay = 0;
+
+/**
+* Global Variables
+* maintains the frame being composed as a grid of
+* cells, one row of it as flushed to curses, and the
+* curses attribute of each palette entry.
+*/
+cell *frame = NULL;
+char *frame_line = NULL;
+chtype *frame_attr = NULL;
+int frame_w = 0,
+    frame_h = 0,
+    frame_batching = TRUE;
+chtype palette[ATTRS];
+int palette_fg[ATTRS];
+
+/**
+* Global Variables
+* maintains the available renderers and the one in use.
+*/
+renderer curses_renderer = { "curses", curses_begin, curses_present, curses_end },
+         ansi_renderer = { "ansi", ansi_begin, ansi_present, ansi_end };
+renderer *renderers[] = { &curses_renderer, &ansi_renderer, NULL };
+renderer *backend = &curses_renderer;
+
+/**
+* Global Variables
+* maintains the ANSI renderer: what each cell was last
+* shown as, the foreground colour the terminal is in and
+* the preallocated output buffer.
+*/
+cell *ansi_shown = NULL;
+char *ansi_buf = NULL;
+int ansi_w = 0,
+    ansi_h = 0,
+    ansi_fg = -1,
+    ansi_fd = STDOUT_FILENO;
+
+/**
+* Global Variables
+* maintains the telemetry ring, filled by the game loop
+* and drained to file by a background thread.
 */
-enemy *enemies;
-int enemy_bullet_index = 0,
-    num_enemies = 0,
-    enemy_index = 0,
-    enemies_destroyed = 0,
-    alarm_delay = 0;
+ring telemetry;
+pthread_t telemetry_thread;
+FILE *telemetry_file = NULL;
 
 /**
 * Main function.
-* @param  void
+* @param  int      argc         number of command line arguments.
+* @param  char     argv         command line arguments, --bench to benchmark,
+*                               --telemetry file to record every tick,
+*                               --renderer name to pick a renderer,
+*                               --scores file to keep the leaderboard in.
 * @return exit_success.
 */
-int main(void) {
+int main(int argc, char **argv) {
   /**
   * Local Variables
-  * maintains the state of the current window size
-  * to determine x, y location of plane.
+  * maintains the state of the current window size.
   */
-  int x = 0,
-      y = 0;
   int max_x = 0,
       max_y = 0;
   /**
@@ -106,24 +436,46 @@ int main(void) {
   * stores user plane selection and games state.
   */
   int plane;
-  char *plane_top,
-       *plane_bot;
+  char *top,
+       *bot;
   int game_over = FALSE;
   /**
+  * Local Variable
+  * stores every entity in the game: the plane, the
+  * enemies and the bullets in flight.
+  */
+  world w;
+  /**
   * Local Variables
-  * stores the distance the plane can move in
-  * the x, y directions.
+  * stores the fixed timestep state: the simulation
+  * advances in SIMSTEP increments while frames are
+  * drawn every FRAMESTEP, interpolated by alpha.
+  */
+  long long last_micros,
+            now_micros,
+            frame_micros,
+            lag = 0;
+  fixed alpha;
+  int keys[KEYQUEUE],
+      queued = 0,
+      pressed,
+      ticked;
+  /**
+  * Local Variable
+  * stores the governor trading quality for frame time.
   */
-  int xdirection = 3,
-      ydirection = 1;
+  governor g;
   /**
   * Local Variables
-  * stores the planes health as well as magazine 
-  * state.
+  * stores the telemetry record for the current tick and
+  * the counters it is measured against.
   */
-  int health = MAXHEALTH,
-      bullet_index = 0,
-      bullets = MAGSIZE;
+  record r = { 0 };
+  int tick = 0,
+      last_fired = 0,
+      last_destroyed = 0,
+      last_spawned = 0;
+  long long start_micros;
   /**
   * Local Variables
   * stores timing information which is used to
@@ -137,6 +489,63 @@ int main(void) {
   * the main window to use with ncurses.
   */
   WINDOW *mainwin;
+  /**
+  * Local Variables
+  * stores the command line options.
+  */
+  int bench = FALSE;
+  char *telemetry_path = NULL,
+       *scores_path = NULL,
+       home_scores[PATH_MAX];
+  /**
+  * Local Variables
+  * stores the leaderboard and this game's rank on it.
+  */
+  leaderboard board = { -1, -1 };
+  long rank = -1;
+
+  // read command line options
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--bench") == 0)
+      bench = TRUE;
+    else if (strcmp(argv[i], "--telemetry") == 0 && i + 1 < argc)
+      telemetry_path = argv[++i];
+    else if (strcmp(argv[i], "--renderer") == 0 && i + 1 < argc && find_renderer(argv[i + 1]) != NULL)
+      backend = find_renderer(argv[++i]);
+    else if (strcmp(argv[i], "--scores") == 0 && i + 1 < argc)
+      scores_path = argv[++i];
+    else {
+      fprintf(stderr, "usage: %s [--bench] [--telemetry file.csv] [--renderer curses|ansi] [--scores file]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // compare output of each renderer instead of playing
+  if (bench) {
+    printf("frames: %d\n", BENCHFRAMES);
+    printf("%-20s %9s %9s %13s\n", "path", "bytes", "/frame", "writes/frame");
+    print_benchmark("curses, monochrome", run_benchmark(&curses_renderer, FALSE, TRUE));
+    print_benchmark("curses, per sprite", run_benchmark(&curses_renderer, TRUE, FALSE));
+    print_benchmark("curses, batched", run_benchmark(&curses_renderer, TRUE, TRUE));
+    print_benchmark("ansi, monochrome", run_benchmark(&ansi_renderer, FALSE, TRUE));
+    print_benchmark("ansi, colour", run_benchmark(&ansi_renderer, TRUE, TRUE));
+    return EXIT_SUCCESS;
+  }
+
+  // keep scores in the home directory unless told otherwise
+  if (scores_path == NULL) {
+    if (getenv("HOME") != NULL &&
+        snprintf(home_scores, sizeof home_scores, "%s/%s", getenv("HOME"), SCORESFILE) < (int) sizeof home_scores)
+      scores_path = home_scores;
+    else
+      scores_path = SCORESFILE;
+  }
+
+  // start recording telemetry if asked to
+  if (telemetry_path != NULL && telemetry_start(telemetry_path) != 0) {
+    fprintf(stderr, "Error opening telemetry file %s.\n", telemetry_path);
+    exit(EXIT_FAILURE);
+  }
 
   // initialize ncurses
   if ((mainwin = initscr()) == NULL ) {
@@ -148,6 +557,7 @@ int main(void) {
   noecho();                                               /* turn off keyboard echo */
   curs_set(FALSE);                                        /* trun off cursor display */
   keypad(mainwin, TRUE);                                  /* turn on special characters */
+  init_palette(has_colors());                             /* use colour when the terminal has it */
 
   display_splash();                                       /* display welcome screen */
 
@@ -155,140 +565,117 @@ int main(void) {
 
   // set plane depending on user selection
   if (plane == 1) {
-    plane_top = "      __!__   ";
-    plane_bot = "----*---o---*----";
+    top = "      __!__   ";
+    bot = "----*---o---*----";
   } else 
   if (plane == 2) {
-    plane_top = "      \\ . /   ";
-    plane_bot = "o______(*)______o";
+    top = "      \\ . /   ";
+    bot = "o______(*)______o";
   } else {
-    plane_top = "      \\ . /   ";
-    plane_bot = "----==( o )==----";
+    top = "      \\ . /   ";
+    bot = "----==( o )==----";
   }
 
-  // allocate memory for game variables
-  bullet *friendly_mag = malloc(MAGSIZE * sizeof (bullet));
-  bullet *enemy_mag = malloc(MAGSIZE * ENEMIES * sizeof (bullet));
-  enemies = malloc (ENEMIES * sizeof (enemy));
-
-
-  init_mag(friendly_mag, FRIENDLY);                       /* initialize friendly mag */
-  init_mag(enemy_mag, !FRIENDLY);                         /* initialize enemy mag */
-  init_enemies(enemies);                                  /* initialize enemies */
+  world_init(&w);                                         /* allocate storage for every archetype */
 
   getmaxyx(stdscr, max_y, max_x);                         /* get screen dimensions */
-  x = max_x / 2 - (PLANEWIDTH / 2);                       /* set plane x to mid screen */
-  y = max_y / 2;                                          /* set plane y to mid screen */
+  spawn_player(&w, top, bot,                              /* put the plane mid screen */
+               TO_FIXED(max_x / 2 - (PLANEWIDTH / 2)), TO_FIXED(max_y / 2));
 
-  timeout(30);                                            /* set getch() timeout to 30ms */
+  timeout(0);                                             /* make getch() non-blocking */
   signal(SIGALRM, alarm_handler);                         /* initialize SIGALRM with handler */
   alarm_delay = my_random(1, 6);                          /* get random interval for alarm delay */
   alarm(alarm_delay);                                     /* set random interval for alarm delay */
   start_timer();                                          /* start the time to determine score */
+  last_micros = start_micros = get_micros();              /* start the simulation clock */
+  governor_init(&g);                                      /* start at full quality */
+  backend->begin();                                       /* hand the screen to the renderer */
 
   while (!game_over) {
 
-    clear();                                              /* clear screen */
-
-    getmaxyx(stdscr, max_y, max_x);                       /* get screen dimensions */
-
-    mvprintw(y-1, x, plane_top);                          /* draw plane top */
-    mvprintw(y, x, plane_bot);                            /* draw plane bottom */
-
-    bullets = update_bullets(friendly_mag, bullets, FRIENDLY); /* update friendly bullet positions */
-    update_bullets(enemy_mag, 0, !FRIENDLY);              /* update enemy bullet positions */
-    update_enemies(friendly_mag, enemy_mag, enemies);     /* update enemy plane positions */
-    health = update_health(enemy_mag, health, x, y);      /* update friendly plane health */
-
-    if (health <= 0)                                      /* if health drops below zero... */
-      game_over = TRUE;                                   /* ...then game is over */
-
-    draw_mag(bullets);                                    /* draw the remaining bullets */
-    draw_health(health);                                  /* draw the remaining health */
-
-    refresh();                                            /* refresh the screen */
-
-    wborder(mainwin, '|', '|', '-', '-', '+', '+', '+', '+'); /* draw boarder around screen */
-
-    int key = getch();                                    /* get user key press */
-
-    usleep(30000);                                        /* sleep 300ms for fluid motion */
-
-    switch (key) {
-
-      case KEY_UP:                                        /* handle key up button push */
-      case 'W':
-      case 'w':
-        if (y > 2)                                        /* if plane is not at top of screen... */
-          y -= ydirection;                                /* ...move plane towards top of screen */
-        break;
-
-      case KEY_DOWN:                                      /* handle key down button push */
-      case 'S':
-      case 's':
-        if (y < max_y - 2)                                /* if plane is not at bottom of screen... */
-          y += ydirection;                                /* ...move plane towards bottom of screen */
-        break;
-
-      case KEY_LEFT:                                      /* handle key left button push */
-      case 'A':
-      case 'a':
-        if (x > xdirection)                               /* if plane is not at left boundry of screen... */
-          x -= xdirection;                                /* ...move plane towards left boundry of screen */
-        break;
-
-      case KEY_RIGHT:                                     /* handle right button push */
-      case 'D':
-      case 'd':
-        if ((x + PLANEWIDTH + xdirection) < max_x)        /* if tip of right wing is not at right boundry... */
-          x += xdirection;                                /* ...move plane towards right boundry of screen */
-        break;
-
-      case ' ':                                           /* handle space key push */
-        if (bullets != 0) {                               /* if there are still bullets left... */
-          bullets--;                                      /* ...decrement bullet count... */
-          shoot_bullet(&friendly_mag[bullet_index++], x + (PLANEWIDTH / 2), y + 1); /* ...shoot a bullet... */
-          bullet_index %= MAGSIZE;                        /* ...and update the bullet index */
-        }
-        break;
-
-      case '\n':                                          /* handle enter button push */
-        if (bullets >= SHOTGUN) {                         /* if there are enough bullets to use shotgun... */
-          bullets -= SHOTGUN;                             /* ...decrement bullet count by shotgun amount */
-          for (int i = 0; i < SHOTGUN; i++) {             /* shoot SHOTGUN many bullets from magazine... */
-            shoot_bullet(&friendly_mag[bullet_index++], x + (i * PLANEWIDTH / 4), y + 1);
-            bullet_index %= MAGSIZE;                      /* ...and update the bullet index after each shot */
-          }
-        }
-        break;
-
-      case 'Q':                                           /* handle the q key press */
-      case 'q':
-        game_over = TRUE;                                 /* quit the current game */
-        break;
+    now_micros = get_micros();                            /* measure time since the last frame... */
+    lag += now_micros - last_micros;                      /* ...and add it to the simulation backlog */
+    last_micros = now_micros;
+    if (lag > (long long) SIMSTEP * MAXCATCHUP)           /* if far behind, drop ticks rather than spiral */
+      lag = (long long) SIMSTEP * MAXCATCHUP;
+
+    while ((pressed = getch()) != ERR)                    /* drain input, queueing every key... */
+      if (queued < KEYQUEUE)                              /* ...for the next simulation tick */
+        keys[queued++] = pressed;
+
+    ticked = FALSE;
+    while (lag >= SIMSTEP && !game_over) {                /* run every simulation tick that is due */
+
+      lag -= SIMSTEP;
+      ticked = TRUE;
+
+      if (input_system(&w, keys, queued))                 /* steer the plane from the queued keys... */
+        game_over = TRUE;                                 /* ...or quit the current game */
+      update_world(&w);                                   /* run every system for this tick */
+
+      if (w.types[ARCH_PLAYER].health[0].hp <= 0)         /* if health drops below zero... */
+        game_over = TRUE;                                 /* ...then game is over */
+
+      queued = 0;                                         /* each key press drives a single tick */
+
+      if (telemetry_file != NULL) {                       /* if recording, queue this tick's record */
+        r.micros = get_micros() - start_micros;
+        r.tick = tick++;
+        r.friendly_bullets = w.types[ARCH_FBULLET].count;
+        r.enemy_bullets = w.types[ARCH_EBULLET].count;
+        r.num_enemies = w.types[ARCH_ENEMY].count;
+        r.health = w.types[ARCH_PLAYER].health[0].hp;
+        r.quality = g.level;
+        r.fired = w.fired - last_fired;
+        r.hits = w.destroyed - last_destroyed;
+        r.spawned = w.spawned - last_spawned;
+        telemetry_push(&r);
+      }
+      last_fired = w.fired;
+      last_destroyed = w.destroyed;
+      last_spawned = w.spawned;
+      r.frames = r.frame_micros = 0;
+    }
 
-      default:                                            /* handle all other key presses */
-        break;                                            /* simply break on invalid keys */
+    if (governor_render(&g, ticked)) {                    /* if the governor has not skipped this frame... */
+      alpha = (fixed) (lag * FIXONE / SIMSTEP);           /* ...find the fraction of the way to the next tick */
+      render_frame(&w, alpha, g.level);                   /* ...and draw the frame */
+      r.frames++;
+      frame_micros = get_micros() - now_micros;           /* measure the drawn frame against its budget */
+      governor_update(&g, frame_micros, now_micros - start_micros);
     }
 
-    usleep(DELAY);                                        /* delay screen updating for smooth rendering */
+    frame_micros = get_micros() - now_micros;
+    if (frame_micros > r.frame_micros)
+      r.frame_micros = frame_micros;
+    if (frame_micros < FRAMESTEP)                         /* sleep off whatever is left of the frame */
+      usleep(FRAMESTEP - frame_micros);
 
   }
 
+  backend->end();                                         /* take the screen back from the renderer */
   micros = stop_timer();                                  /* stop timer */
   time_alive = micros / (float) 1000000;                  /* convert from microseconds to seconds */
 
   alarm(0);                                               /* disable alarm from triggering again */
   timeout(-1);                                            /* disable timeout for getch() */
 
-  score = calculate_score(time_alive, enemies_destroyed); /* calculate score */
-  display_game_over(mainwin, score);                      /* display game over screen and user score */
+  score = calculate_score(time_alive, w.destroyed);       /* calculate score */
+  if (leaderboard_open(&board, scores_path) == 0)         /* if the leaderboard can be opened... */
+    rank = leaderboard_record(&board, score, w.destroyed, (int) time_alive); /* ...record the game on it */
+  display_game_over(mainwin, score, board.log_fd >= 0 ? &board : NULL, rank); /* display game over screen and user score */
 
   // clean up
   endwin();                                             
-  free(friendly_mag);
-  free(enemy_mag);
-  free(enemies);
+  telemetry_stop();
+  governor_report(&g);
+  leaderboard_close(&board);
+  world_free(&w);
+  free(frame);
+  free(frame_line);
+  free(frame_attr);
+  free(ansi_shown);
+  free(ansi_buf);
 
   return EXIT_SUCCESS;
 }
@@ -450,328 +837,1597 @@ int select_plane() {
 }
 
 /**
-* initialize a magazine. 
-* @param  bullet    mag           pointer to an array of bullets.
-* @param  int       friendly      > 0 if friendly, enemy otherwise.
+* Sets up an empty archetype with storage for every component
+* in its mask. 
+* @param  archetype a            pointer to the archetype.
+* @param  unsigned  mask         components and tags its entities have.
+* @param  int       capacity     most entities it can hold.
 * @return void
 */
-void init_mag(bullet *mag, int friendly) {
-  if (friendly) {
-    for (int i = 0; i < MAGSIZE; i++) {
-      bullet *b = (bullet*) malloc(sizeof (bullet));      
-      b->x = 0;
-      b->y = 0;
-      b->dir = 1;
-      b->s = '.';
-      b->alive = FALSE;
-      mag[i] = *b;
-    }
-  } else {
-    for (int i = 0; i < ENEMIES * MAGSIZE; i++) {
-      bullet *b = (bullet*) malloc(sizeof (bullet));
-      b->x = 0;
-      b->y = 0;
-      b->dir = -1;
-      b->s = '*';
-      b->alive = FALSE;
-      mag[i] = *b;
-    }
-  }
+void archetype_init(archetype *a, unsigned mask, int capacity) {
+  a->mask = mask;
+  a->count = 0;
+  a->capacity = capacity;
+  a->position = mask & C_POSITION ? calloc(capacity, sizeof (position)) : NULL;
+  a->velocity = mask & C_VELOCITY ? calloc(capacity, sizeof (velocity)) : NULL;
+  a->sprite = mask & C_SPRITE ? calloc(capacity, sizeof (sprite)) : NULL;
+  a->hitbox = mask & C_HITBOX ? calloc(capacity, sizeof (hitbox)) : NULL;
+  a->health = mask & C_HEALTH ? calloc(capacity, sizeof (health)) : NULL;
+  a->gun = mask & C_GUN ? calloc(capacity, sizeof (gun)) : NULL;
+}
+
+/**
+* Adds an entity to the end of an archetype with its
+* components zeroed. 
+* @param  archetype a            pointer to the archetype.
+* @return int                    index of the new entity, -1 if full.
+*/
+int archetype_add(archetype *a) {
+  int i = a->count;
+
+  if (i == a->capacity)
+    return -1;
+  if (a->position) memset(&a->position[i], 0, sizeof (position));
+  if (a->velocity) memset(&a->velocity[i], 0, sizeof (velocity));
+  if (a->sprite)   memset(&a->sprite[i], 0, sizeof (sprite));
+  if (a->hitbox)   memset(&a->hitbox[i], 0, sizeof (hitbox));
+  if (a->health)   memset(&a->health[i], 0, sizeof (health));
+  if (a->gun)      memset(&a->gun[i], 0, sizeof (gun));
+  a->count++;
+  return i;
+}
+
+/**
+* Removes an entity by moving the last one into its place,
+* keeping every component array dense. Systems that remove
+* entities walk the archetype backwards, so the moved entity
+* has already been visited. 
+* @param  archetype a            pointer to the archetype.
+* @param  int       i            index of the entity to remove.
+* @return void
+*/
+void archetype_remove(archetype *a, int i) {
+  int last = --a->count;
+
+  if (a->position) a->position[i] = a->position[last];
+  if (a->velocity) a->velocity[i] = a->velocity[last];
+  if (a->sprite)   a->sprite[i] = a->sprite[last];
+  if (a->hitbox)   a->hitbox[i] = a->hitbox[last];
+  if (a->health)   a->health[i] = a->health[last];
+  if (a->gun)      a->gun[i] = a->gun[last];
 }
 
 /**
-* initialize an enemey. 
-* @param  enemy    enemies     pointer to an array of enemies.
+* Sets up a world with an empty archetype for each kind of
+* entity in the game. 
+* @param  world    w            pointer to the world.
 * @return void
 */
-void init_enemies(enemy *enemies) {
-  for (int i = 0; i < ENEMIES; i++) {
-    enemy *e = (enemy*) malloc(sizeof (enemy));
-    e->top = " .'.";
-    e->cab = " |o|";
-    e->mid = ".'o'.";
-    e->bot = "|.-.|";
-    e->x = 0;
-    e->y = 0;
-    e->alive = FALSE;
-    enemies[i] = *e;
+void world_init(world *w) {
+  archetype_init(&w->types[ARCH_PLAYER],
+                 C_POSITION | C_VELOCITY | C_SPRITE | C_HITBOX | C_HEALTH | C_GUN | C_FRIENDLY, 1);
+  archetype_init(&w->types[ARCH_ENEMY],
+                 C_POSITION | C_VELOCITY | C_SPRITE | C_HITBOX | C_HEALTH | C_GUN | C_WANDER, ENEMIES);
+  archetype_init(&w->types[ARCH_FBULLET],
+                 C_POSITION | C_VELOCITY | C_SPRITE | C_PROJECTILE | C_FRIENDLY, MAGSIZE);
+  archetype_init(&w->types[ARCH_EBULLET],
+                 C_POSITION | C_VELOCITY | C_SPRITE | C_PROJECTILE, ENEMIES * MAGSIZE);
+  w->spawned = 0;
+  w->destroyed = 0;
+  w->fired = 0;
+  w->alarms_seen = alarms;
+}
+
+/**
+* Releases the component storage of every archetype. 
+* @param  world    w            pointer to the world.
+* @return void
+*/
+void world_free(world *w) {
+  for (int t = 0; t < ARCHETYPES; t++) {
+    free(w->types[t].position);
+    free(w->types[t].velocity);
+    free(w->types[t].sprite);
+    free(w->types[t].hitbox);
+    free(w->types[t].health);
+    free(w->types[t].gun);
   }
 }
 
 /**
-* Shoot a new bullet from a starting x,y position. 
-* @param  bullet   b    pointer to a bullet in a magizine.
-* @param  int      x    new bullet x position.
-* @param  int      y    new bullet y position.
+* Spawn the player's plane. 
+* @param  world    w            pointer to the world.
+* @param  char     top          top row of the plane.
+* @param  char     bot          bottom row of the plane.
+* @param  fixed    x            plane x position.
+* @param  fixed    y            plane y position.
 * @return void
 */
-void shoot_bullet(bullet *b, int x, int y) {
-    b->x = x;
-    b->y = y;
-    b->alive = TRUE;
+void spawn_player(world *w, char *top, char *bot, fixed x, fixed y) {
+  archetype *a = &w->types[ARCH_PLAYER];
+  int i = archetype_add(a);
+
+  a->position[i] = (position) { x, y, x, y };
+  a->sprite[i] = (sprite) { { top, bot }, 2, ATTR_PLAYER };
+  a->hitbox[i].width = TO_FIXED(PLANEWIDTH);
+  a->health[i].hp = MAXHEALTH;
+  a->gun[i] = (gun) { 0, TO_FIXED(PLANEWIDTH / 2), FIXONE, TO_FIXED(PLANEWIDTH / 4) };
 }
 
 /**
-* Spawn a new enemey. 
-* @param  bullet   mag          pointer to a magazine.
-* @param  int      bullets      number of bullets.
-* @param  int      friendly     > 0 if friendly, enemy otherwise.
-* @return int      bullets      updated number of bullets in magazine
+* Spawn a new enemey, if there is room for one. 
+* @param  world    w            pointer to the world.
+* @param  fixed    x            new enemy x position.
+* @param  fixed    y            new enemy y position.
+* @return void
 */
-int update_bullets(bullet *mag, int bullets, int friendly) {
-  /**
-  * Local Variables
-  * stores max screen size and remaining
-  * number of bullets in mag depending on
-  * whether or not mag is friendly.
-  */
-  int max_x,
-      max_y;
-  int total_bullets;
+void spawn_enemy(world *w, fixed x, fixed y) {
+  archetype *a = &w->types[ARCH_ENEMY];
+  int i = archetype_add(a);
+
+  if (i < 0)
+    return;
+  a->position[i] = (position) { x, y, x, y };
+  a->sprite[i] = (sprite) { { " .'.", " |o|", ".'o'.", "|.-.|" }, 4, ATTR_ENEMY };
+  a->hitbox[i].width = TO_FIXED(ENEMYWIDTH);
+  a->health[i].hp = 1;
+  a->gun[i] = (gun) { 0, TO_FIXED(2), TO_FIXED(-4), 0 };
+  w->spawned++;
+}
 
-  getmaxyx(stdscr, max_y, max_x);
-  if (friendly)
-    total_bullets = MAGSIZE;
-  else
-    total_bullets = MAGSIZE * ENEMIES;
-  for (int i = 0; i < total_bullets; i++) {
-    // if bullet at position i goes out of screen, end bullet
-    if (mag[i].y >= max_y && mag[i].alive & mag[i].y != 0) {
-      mag[i].alive = FALSE;
-      bullets++;
-    } else {
-      // remove current bullet at position i, advance and print
-      // the bullet in its new position
-      mvprintw(mag[i].y, mag[i].x, " ");
-      mag[i].y += mag[i].dir;
-      mvprintw(mag[i].y, mag[i].x, &mag[i].s);
-    }
+/**
+* Shoot a new bullet from a starting x,y position. 
+* @param  archetype a            pointer to the bullet archetype.
+* @param  fixed     x            new bullet x position.
+* @param  fixed     y            new bullet y position.
+* @return void
+*/
+void shoot_bullet(archetype *a, fixed x, fixed y) {
+  int i = archetype_add(a);
+
+  if (i < 0)
+    return;
+  a->position[i] = (position) { x, y, x, y };
+  if (a->mask & C_FRIENDLY) {
+    a->velocity[i].vy = BULLETSPEED;
+    a->sprite[i] = (sprite) { { "." }, 1, ATTR_FBULLET };
+  } else {
+    a->velocity[i].vy = -BULLETSPEED;
+    a->sprite[i] = (sprite) { { "*" }, 1, ATTR_EBULLET };
   }
-  return bullets;
 }
 
 /**
-* Spawn a new enemey. 
-* @param  enemy    e    pointer to an enemy to spawn.
-* @param  int      x    new enemy x position.
-* @param  int      y    new enemy y position.
+* Runs every system for one simulation tick, after input has
+* been applied to the player. 
+* @param  world    w            pointer to the world.
 * @return void
 */
-void spawn_enemy(enemy *e, int x, int y) {
-  e->x = x;
-  e->y = y;
-  e->alive = TRUE;
-  num_enemies++;
+void update_world(world *w) {
+  spawn_system(w);                                        /* spawn enemies for any alarms that went off */
+  wander_system(w);                                       /* pick each enemy's next move */
+  movement_system(w);                                     /* move everything by its velocity */
+  firing_system(w);                                       /* fire every gun whose trigger is pulled */
+  collision_system(w);                                    /* find bullets that reached a target */
+  health_system(w);                                       /* apply damage and destroy the dead */
 }
 
 /**
-* Draw current plane magazine capacity on screen. 
-* @param  int      bullets      current number of bullets in magazine.
-* @return void
+* Steers the player from every key pressed since the last
+* tick, clearing the previous tick's movement. A later move
+* replaces an earlier one, but never a shot. 
+* @param  world    w            pointer to the world.
+* @param  int      keys         keys pressed, oldest first.
+* @param  int      n            number of keys pressed.
+* @return int                   > 0 if the player asked to quit.
 */
-void draw_mag(int bullets) {
+int input_system(world *w, const int *keys, int n) {
+  w->types[ARCH_PLAYER].velocity[0].vx = 0;
+  w->types[ARCH_PLAYER].velocity[0].vy = 0;
+  for (int i = 0; i < n; i++)
+    if (input_key(w, keys[i]))
+      return TRUE;
+  return FALSE;
+}
+
+/**
+* Steers the player from a single key press. 
+* @param  world    w            pointer to the world.
+* @param  int      key          key pressed.
+* @return int                   > 0 if the player asked to quit.
+*/
+int input_key(world *w, int key) {
   /**
   * Local Variables
-  * stores max screen size.
+  * stores the player's components and screen size.
   */
+  archetype *a = &w->types[ARCH_PLAYER];
+  position *p = &a->position[0];
+  velocity *v = &a->velocity[0];
+  gun *g = &a->gun[0];
+  int room = w->types[ARCH_FBULLET].capacity - w->types[ARCH_FBULLET].count;
   int max_x,
       max_y;
 
   getmaxyx(stdscr, max_y, max_x);
-  for (int i = 0; i < MAGSIZE; i++) {
-    if (i < bullets)
-      mvprintw(i + 2, max_x - 3, "o");
-    else
-      mvprintw(i + 2, max_x - 3, " ");
+
+  switch (key) {
+
+    case KEY_UP:                                          /* handle key up button push */
+    case 'W':
+    case 'w':
+      if (TO_CELL(p->y) > 2)                              /* if plane is not at top of screen... */
+        v->vy = -PLANESPEEDY;                             /* ...move plane towards top of screen */
+      break;
+
+    case KEY_DOWN:                                        /* handle key down button push */
+    case 'S':
+    case 's':
+      if (TO_CELL(p->y) < max_y - 2)                      /* if plane is not at bottom of screen... */
+        v->vy = PLANESPEEDY;                              /* ...move plane towards bottom of screen */
+      break;
+
+    case KEY_LEFT:                                        /* handle key left button push */
+    case 'A':
+    case 'a':
+      if (p->x > PLANESPEEDX)                             /* if plane is not at left boundry of screen... */
+        v->vx = -PLANESPEEDX;                             /* ...move plane towards left boundry of screen */
+      break;
+
+    case KEY_RIGHT:                                       /* handle right button push */
+    case 'D':
+    case 'd':
+      if (p->x + TO_FIXED(PLANEWIDTH) + PLANESPEEDX < TO_FIXED(max_x)) /* if tip of right wing is not at right boundry... */
+        v->vx = PLANESPEEDX;                              /* ...move plane towards right boundry of screen */
+      break;
+
+    case ' ':                                             /* handle space key push */
+      if (room != 0)                                      /* if there are still bullets left... */
+        g->trigger = 1;                                   /* ...shoot a bullet */
+      break;
+
+    case '\n':                                            /* handle enter button push */
+      if (room >= SHOTGUN)                                /* if there are enough bullets to use shotgun... */
+        g->trigger = SHOTGUN;                             /* ...shoot SHOTGUN many bullets */
+      break;
+
+    case 'Q':                                             /* handle the q key press */
+    case 'q':
+      return TRUE;                                        /* quit the current game */
+
+    default:                                              /* handle all other key presses */
+      break;                                              /* simply break on invalid keys */
   }
+  return FALSE;
 }
 
 /**
-* Draw current plane health on screen. 
-* @param  int      health        current plane health.
+* Spawns an enemy at a random x position for every alarm that
+* has gone off since the last tick. 
+* @param  world    w            pointer to the world.
 * @return void
 */
-void draw_health(int health) {
-  for (int i = 0; i < health; i++)
-    mvprintw(1, i + 2, "+");
+void spawn_system(world *w) {
+  /**
+  * Local Variables
+  * stores screen dimensions.
+  */
+  int max_x,
+      max_y;
+
+  getmaxyx(stdscr, max_y, max_x);
+  while (w->alarms_seen != alarms) {
+    w->alarms_seen++;
+    spawn_enemy(w, TO_FIXED(my_random(0, max_x - ENEMYWIDTH)), TO_FIXED(max_y - 3));
+  }
 }
 
 /**
-* Updates all enemy positions as well as their alive states. 
-* @param  bullet   friendly_mag     pointer to friendly magazine of bullets.
-* @param  bullet   enemy_mag        pointer to enemy magazine of bullets.
-* @param  enemy    enemeies         pointer to an array of enemies.
+* Picks a random move for every wandering entity, pulling
+* the trigger when it decides to stay put. 
+* @param  world    w            pointer to the world.
 * @return void
 */
-void update_enemies(bullet *friendly_mag, bullet *enemy_mag, enemy *enemies) {
+void wander_system(world *w) {
   /**
   * Local Variables
-  * stores random x,y positions of nex
-  * enemy movements.
+  * stores random x,y directions of the next
+  * movement and screen dimensions.
   */
   int xrand,
       yrand;
-  /**
-  * Local Variables
-  * stores max screen size.
-  */
   int max_x,
       max_y;
+  archetype *a;
+  position *p;
 
   getmaxyx(stdscr, max_y, max_x);
-  for (int i = 0; i < ENEMIES; i++) {
-    if (enemies[i].alive) {
-      // if enemy is alive, draw it in its x,y position
-      mvprintw(enemies[i].y - 3, enemies[i].x, enemies[i].top);
-      mvprintw(enemies[i].y - 2, enemies[i].x, enemies[i].cab);
-      mvprintw(enemies[i].y - 1, enemies[i].x, enemies[i].mid);
-      mvprintw(enemies[i].y - 0, enemies[i].x, enemies[i].bot);
+  for (int t = 0; t < ARCHETYPES; t++) {
+    a = &w->types[t];
+    if (!HAS(a, C_WANDER | C_POSITION | C_VELOCITY | C_GUN))
+      continue;
+    for (int i = 0; i < a->count; i++) {
+      p = &a->position[i];
 
       // randomly decide next x,y movement direction
       // -1 for left or up, +1 for right or down
       xrand = my_random(-1, 1);
-      while (enemies[i].x + xrand <= 0 || enemies[i].x + xrand + ENEMYWIDTH >= max_x)
+      while (p->x + xrand * ENEMYSPEED <= 0 ||
+             TO_CELL(p->x + xrand * ENEMYSPEED) + ENEMYWIDTH >= max_x)
         xrand = my_random(-1, 1);
       yrand = my_random(-1, 1);
-      while (enemies[i].y + yrand <= 0 || enemies[i].y + yrand  >= max_y)
+      while (p->y + yrand * ENEMYSPEED <= 0 ||
+             TO_CELL(p->y + yrand * ENEMYSPEED) >= max_y)
         yrand = my_random(-1, 1);
 
-      // add x,y direction to current enemy position
-      enemies[i].x += xrand;
-      enemies[i].y += yrand;
+      a->velocity[i].vx = xrand * ENEMYSPEED;
+      a->velocity[i].vy = yrand * ENEMYSPEED;
 
       // if the randomly selected positions end up not
       // moving the enemy, shoot a bullet
-      if (xrand == 0 && yrand == 0) {
-        shoot_bullet(&enemy_mag[enemy_bullet_index++], enemies[i].x + 2, enemies[i].y - 4);
-        enemy_bullet_index %= ENEMIES * MAGSIZE;
-      } 
-    } else {
-      // if not alive, erase the current enemy
-      mvprintw(enemies[i].y - 3, enemies[i].x, " ");
-      mvprintw(enemies[i].y - 2, enemies[i].x, " ");
-      mvprintw(enemies[i].y - 1, enemies[i].x, " ");
-      mvprintw(enemies[i].y - 0, enemies[i].x, " ");
+      if (xrand == 0 && yrand == 0)
+        a->gun[i].trigger = 1;
     }
-    // for every bullet, if a bullet has reached an 
-    // enemy, destroy that enemy
-    for (int j = 0; j < MAGSIZE * ENEMIES; j++) {
-      if (enemies[i].y == friendly_mag[j].y) {
-        if (friendly_mag[j].x >= enemies[i].x && friendly_mag[j].x <= enemies[i].x + ENEMYWIDTH) {
-          num_enemies--;
-          enemies_destroyed++;
-          enemies[i].alive = FALSE;
-        }
+  }
+}
+
+/**
+* Moves every entity by its velocity, remembering where it was
+* for interpolation, and removes projectiles that leave the
+* screen. 
+* @param  world    w            pointer to the world.
+* @return void
+*/
+void movement_system(world *w) {
+  /**
+  * Local Variables
+  * stores the screen height.
+  */
+  int max_y = getmaxy(stdscr);
+  archetype *a;
+  position *p;
+
+  for (int t = 0; t < ARCHETYPES; t++) {
+    a = &w->types[t];
+    if (!HAS(a, C_POSITION))
+      continue;
+    for (int i = a->count - 1; i >= 0; i--) {
+      p = &a->position[i];
+      p->prev_x = p->x;
+      p->prev_y = p->y;
+      if (a->mask & C_VELOCITY) {
+        p->x += a->velocity[i].vx;
+        p->y += a->velocity[i].vy;
       }
+      if ((a->mask & C_PROJECTILE) && (p->y < 0 || TO_CELL(p->y) >= max_y))
+        archetype_remove(a, i);
     }
   }
 }
 
 /**
-* Returns a random number between min and max. 
-* @param  int      min          minimum of range.
-* @param  int      max          maximum of range.
-* @return int                   a random integer between min and max.
+* Fires a bullet, or a spread of them, from every gun whose
+* trigger is pulled and whose side has room for the volley. 
+* @param  world    w            pointer to the world.
+* @return void
 */
-int my_random(int min, int max) {
-   return min + rand() / (RAND_MAX / (max - min + 1) + 1);
+void firing_system(world *w) {
+  /**
+  * Local Variables
+  * stores the shooting archetype and the one its
+  * bullets belong to.
+  */
+  archetype *a,
+            *bullets;
+  position *p;
+  gun *g;
+
+  for (int t = 0; t < ARCHETYPES; t++) {
+    a = &w->types[t];
+    if (!HAS(a, C_POSITION | C_GUN))
+      continue;
+    bullets = &w->types[a->mask & C_FRIENDLY ? ARCH_FBULLET : ARCH_EBULLET];
+    for (int i = 0; i < a->count; i++) {
+      g = &a->gun[i];
+      p = &a->position[i];
+      if (g->trigger == 0)
+        continue;
+      if (bullets->capacity - bullets->count >= g->trigger) {
+        for (int k = 0; k < g->trigger; k++) {
+          if (g->trigger == 1)
+            shoot_bullet(bullets, p->x + g->muzzle_x, p->y + g->muzzle_y);
+          else
+            shoot_bullet(bullets, p->x + k * g->spread, p->y + g->muzzle_y);
+        }
+        if (a->mask & C_FRIENDLY)
+          w->fired += g->trigger;
+      }
+      g->trigger = 0;
+    }
+  }
 }
 
 /**
-* Updates current health depending on bullet positions. 
-* @param  int      signal       the signal id number
+* Damages every target on the row of a bullet from the other
+* side and within its width. 
+* @param  world    w            pointer to the world.
 * @return void
 */
-void alarm_handler(int signal) {
+void collision_system(world *w) {
   /**
   * Local Variables
-  * stores new x,y position for new enemy as 
-  * well as screen dimensions.
+  * stores the projectile and target archetypes and
+  * the target being tested.
   */
-  int x,
-      y;
-  int max_x,
-      max_y;
-
-  // if more enemeies are allowed, spawn a new
-  // enemy at a random x,y position on screen
-  if (num_enemies < ENEMIES) {
-    getmaxyx(stdscr, max_y, max_x);
-    x = my_random(0, max_x - ENEMYWIDTH);
-    y = max_y - 3;
-    spawn_enemy(&enemies[enemy_index++], x, y);
-    enemy_index %= ENEMIES;
+  archetype *shots,
+            *targets;
+  position *target;
+  fixed width;
+
+  for (int s = 0; s < ARCHETYPES; s++) {
+    shots = &w->types[s];
+    if (!HAS(shots, C_PROJECTILE | C_POSITION) || shots->count == 0)
+      continue;
+    for (int t = 0; t < ARCHETYPES; t++) {
+      targets = &w->types[t];
+      if (!HAS(targets, C_POSITION | C_HITBOX | C_HEALTH) ||
+          (targets->mask & C_FRIENDLY) == (shots->mask & C_FRIENDLY))
+        continue;
+      for (int j = 0; j < targets->count; j++) {
+        target = &targets->position[j];
+        width = targets->hitbox[j].width;
+        for (int i = 0; i < shots->count; i++) {
+          if (TO_CELL(shots->position[i].y) == TO_CELL(target->y) &&
+              shots->position[i].x >= target->x && shots->position[i].x <= target->x + width)
+            targets->health[j].damage++;
+        }
+      }
+    }
   }
-
-  // reset the alarm for a random duration
-  alarm_delay = my_random(MINALRM, MAXALRM);
-  alarm(alarm_delay);
 }
 
 /**
-* Updates current health depending on bullet positions. 
-* @param  bullet   enemy_mag     enemy magazine of bullets.
-* @param  int      health        current plane health.
-* @param  int      x             current plane x position.
-* @param  int      y             current plane y position.
-* @return int      health        updated plane health.
-*/
-int update_health(bullet *enemy_mag, int health, int x, int y) {
-  // if a bullet has reached the plane, decrement it's health
-  for (int i = 0; i < MAGSIZE * ENEMIES; i++) {
-    if (enemy_mag[i].y == y) {
-      if (enemy_mag[i].x >= x && enemy_mag[i].x <= x + PLANEWIDTH)
-        health--;
+* Applies damage, destroying anything not on the player's side
+* once its health runs out. The player's plane is left for the
+* game loop to end the game. 
+* @param  world    w            pointer to the world.
+* @return void
+*/
+void health_system(world *w) {
+  archetype *a;
+  health *h;
+
+  for (int t = 0; t < ARCHETYPES; t++) {
+    a = &w->types[t];
+    if (!HAS(a, C_HEALTH))
+      continue;
+    for (int i = a->count - 1; i >= 0; i--) {
+      h = &a->health[i];
+      h->hp -= h->damage;
+      h->damage = 0;
+      if (h->hp <= 0 && !(a->mask & C_FRIENDLY)) {
+        archetype_remove(a, i);
+        w->destroyed++;
+      }
     }
   }
-  return health;
 }
 
 /**
-* Memorizes the starting time. 
-* @return void
+* Returns the screen cell between two fixed point positions. 
+* @param  fixed    prev         position at the previous tick.
+* @param  fixed    cur          position at the current tick.
+* @param  fixed    alpha        progress towards the next tick, 0 to FIXONE.
+* @return int                   the interpolated screen cell.
 */
-void start_timer() { 
-    gettimeofday(&start, NULL);
+int interpolate(fixed prev, fixed cur, fixed alpha) {
+  return TO_CELL(prev + (cur - prev) * alpha / FIXONE);
 }
- 
+
 /**
-* Determines end time and computes the elapsed time. 
-* @return time the reaction time of the user in msecs.
+* Draws every entity with a sprite between its last two
+* simulated positions. A sprite's last row sits on the
+* entity's position. 
+* @param  world    w            pointer to the world.
+* @param  fixed    alpha        progress towards the next tick.
+* @param  fixed    range        rows from the plane to draw projectiles within, 0 for all.
+* @return void
 */
-long stop_timer() { 
+void render_system(world *w, fixed alpha, fixed range) {
   /**
   * Local Variables
-  * stores time difference between end and start.
+  * stores the interpolated screen position and the
+  * row the plane is on.
   */
-  long time;
+  int x,
+      y;
+  fixed near_y = w->types[ARCH_PLAYER].position[0].y;
+  archetype *a;
+  position *p;
+  sprite *s;
+
+  for (int t = 0; t < ARCHETYPES; t++) {
+    a = &w->types[t];
+    if (!HAS(a, C_POSITION | C_SPRITE))
+      continue;
+    for (int i = 0; i < a->count; i++) {
+      p = &a->position[i];
+      s = &a->sprite[i];
+      if (range != 0 && (a->mask & C_PROJECTILE) && abs(p->y - near_y) > range)
+        continue;
+      x = interpolate(p->prev_x, p->x, alpha);
+      y = interpolate(p->prev_y, p->y, alpha);
+      for (int r = 0; r < s->height; r++)
+        frame_put(y - (s->height - 1) + r, x, s->rows[r], s->attr);
+    }
+  }
+}
 
-    gettimeofday(&end, NULL);
-    time = 
-      (end.tv_sec - start.tv_sec) 
-      * 1000000 + 
-      (end.tv_usec - start.tv_usec);
-    return time;
+/**
+* Draw current plane magazine capacity on screen. 
+* @param  int      bullets      current number of bullets in magazine.
+* @return void
+*/
+void draw_mag(int bullets) {
+  for (int i = 0; i < MAGSIZE; i++) {
+    if (i < bullets)
+      frame_put(i + 2, frame_w - 3, "o", ATTR_MAG);
+    else
+      frame_put(i + 2, frame_w - 3, " ", ATTR_MAG);
+  }
 }
 
 /**
-* Calculates score based on time alive and enemeies destroyed. 
-* @return int         final score.
+* Draw current plane health on screen. 
+* @param  int      health        current plane health.
+* @return void
 */
-int calculate_score(float time_alive, int enemies_destroyed) {
-  return (int) time_alive * enemies_destroyed;
+void draw_health(int health) {
+  for (int i = 0; i < health; i++)
+    frame_put(1, i + 2, "+", ATTR_HEALTH);
+}
+
+/**
+* Draw the boarder around the edge of the screen. 
+* @param  int      simple       > 0 to draw only the corners.
+* @return void
+*/
+void draw_border(int simple) {
+  for (int x = 1; x < frame_w - 1 && !simple; x++) {
+    frame_put(0, x, "-", ATTR_BORDER);
+    frame_put(frame_h - 1, x, "-", ATTR_BORDER);
+  }
+  for (int y = 1; y < frame_h - 1 && !simple; y++) {
+    frame_put(y, 0, "|", ATTR_BORDER);
+    frame_put(y, frame_w - 1, "|", ATTR_BORDER);
+  }
+  frame_put(0, 0, "+", ATTR_BORDER);
+  frame_put(0, frame_w - 1, "+", ATTR_BORDER);
+  frame_put(frame_h - 1, 0, "+", ATTR_BORDER);
+  frame_put(frame_h - 1, frame_w - 1, "+", ATTR_BORDER);
+}
+
+/**
+* Compose a full game frame and hand it to the renderer. 
+* @param  world    w                pointer to the world.
+* @param  fixed    alpha            progress towards the next tick.
+* @param  int      quality          governor quality level to draw at.
+* @return void
+*/
+void render_frame(world *w, fixed alpha, int quality) {
+  archetype *player = &w->types[ARCH_PLAYER],
+            *mag = &w->types[ARCH_FBULLET];
+
+  if (quality >= QUALITY_STATIC)                          /* stop interpolating when degraded */
+    alpha = FIXONE;
+
+  frame_begin();                                          /* start from a blank frame */
+  render_system(w, alpha, quality >= QUALITY_CULL ? CULLRANGE : 0); /* draw every entity between its last two states */
+  draw_mag(mag->capacity - mag->count);                   /* draw the remaining bullets */
+  draw_health(player->health[0].hp);                      /* draw the remaining health */
+  draw_border(quality >= QUALITY_BORDER);                 /* draw boarder around screen */
+  backend->present();                                     /* put the frame on screen */
 }
 
-void display_game_over(WINDOW *mainwin, int score) {
+/**
+* Build the palette of curses attributes used by the frame. 
+* @param  int      color        > 0 to use colour, monochrome otherwise.
+* @return void
+*/
+void init_palette(int color) {
   /**
   * Local Variables
-  * stores x,y position for lettering as 
-  * well as screen dimensions.
+  * stores the background colour, which is the terminal
+  * default where supported, and the offset to the bright
+  * colours used instead of A_BOLD, since turning bold off
+  * resets every other attribute as well.
+  */
+  int bg = -1,
+      bright;
+
+  for (int i = 0; i < ATTRS; i++) {
+    palette[i] = A_NORMAL;
+    palette_fg[i] = -1;
+  }
+  if (!color)
+    return;
+
+  start_color();
+  if (use_default_colors() == ERR)
+    bg = COLOR_BLACK;
+  bright = COLORS >= 16 ? 8 : 0;
+  init_pair(ATTR_PLAYER,  COLOR_CYAN + bright,   bg);
+  init_pair(ATTR_ENEMY,   COLOR_RED,     bg);
+  init_pair(ATTR_FBULLET, COLOR_YELLOW + bright, bg);
+  init_pair(ATTR_EBULLET, COLOR_MAGENTA, bg);
+  init_pair(ATTR_HEALTH,  COLOR_GREEN,   bg);
+  init_pair(ATTR_MAG,     COLOR_YELLOW,  bg);
+  init_pair(ATTR_BORDER,  COLOR_BLUE,    bg);
+  for (int i = 1; i < ATTRS; i++) {
+    short fg, pair_bg;
+
+    pair_content(i, &fg, &pair_bg);
+    palette[i] = COLOR_PAIR(i);
+    palette_fg[i] = fg;
+  }
+}
+
+/**
+* Start a new frame, resizing it to the screen if needed. 
+* @return void
+*/
+void frame_begin() {
+  /**
+  * Local Variables
+  * stores max screen size.
+  */
+  int max_x,
+      max_y;
+
+  getmaxyx(stdscr, max_y, max_x);
+  if (max_x != frame_w || max_y != frame_h) {
+    frame_w = max_x;
+    frame_h = max_y;
+    frame = realloc(frame, frame_w * frame_h * sizeof (cell));
+    frame_line = realloc(frame_line, frame_w + 1);
+    frame_attr = realloc(frame_attr, frame_w * sizeof (chtype));
+  }
+  for (int i = 0; i < frame_w * frame_h; i++) {
+    frame[i].ch = ' ';
+    frame[i].attr = ATTR_NONE;
+  }
+}
+
+/**
+* Write a string into the frame, clipped to the screen. 
+* @param  int      y            screen row.
+* @param  int      x            screen column of the first character.
+* @param  char     s            string to write.
+* @param  int      attr         palette entry to draw it with.
+* @return void
+*/
+void frame_put(int y, int x, const char *s, int attr) {
+  if (y < 0 || y >= frame_h)
+    return;
+  for (; *s; s++, x++) {
+    if (x >= 0 && x < frame_w) {
+      frame[y * frame_w + x].ch = *s;
+      frame[y * frame_w + x].attr = attr;
+    }
+  }
+}
+
+/**
+* Hand the frame to curses one attribute run at a time. 
+* A blank looks the same in any attribute, so when batching
+* each blank takes the attribute of the next glyph on its row
+* and joins that glyph's run instead of forcing a change of
+* its own.
+* @return void
+*/
+void frame_flush() {
+  /**
+  * Local Variables
+  * stores the attribute carried back over blanks and the
+  * start of the current run.
+  */
+  chtype attr;
+  int start;
+  cell *row;
+
+  for (int y = 0; y < frame_h; y++) {
+    row = &frame[y * frame_w];
+    attr = A_NORMAL;
+    for (int x = frame_w - 1; x >= 0; x--) {
+      if (row[x].ch != ' ')
+        attr = palette[(int) row[x].attr];
+      else if (!frame_batching)
+        attr = A_NORMAL;
+      frame_line[x] = row[x].ch;
+      frame_attr[x] = attr;
+    }
+    start = 0;
+    for (int x = 1; x <= frame_w; x++) {
+      if (x == frame_w || frame_attr[x] != frame_attr[start]) {
+        attrset(frame_attr[start]);
+        mvaddnstr(y, start, &frame_line[start], x - start);
+        start = x;
+      }
+    }
+  }
+  attrset(A_NORMAL);
+}
+
+/**
+* Curses renderer: nothing to set up, as curses owns the screen. 
+* @return void
+*/
+void curses_begin() {
+}
+
+/**
+* Curses renderer: hand the frame to curses and let it work
+* out what has changed. 
+* @return void
+*/
+void curses_present() {
+  frame_flush();                                          /* write the frame out in attribute runs */
+  refresh();                                              /* refresh the screen */
+}
+
+/**
+* Curses renderer: nothing to tear down. 
+* @return void
+*/
+void curses_end() {
+}
+
+/**
+* ANSI renderer: forget what is on screen so the first frame
+* clears and repaints it. 
+* @return void
+*/
+void ansi_begin() {
+  ansi_w = 0;
+  ansi_h = 0;
+}
+
+/**
+* ANSI renderer: compare the frame with what was last shown and
+* build the escape sequences for every changed cell in the
+* preallocated buffer, sent with a single write(). Blanks never
+* change the colour, long runs of them are erased in one
+* sequence, and short gaps on a row are written over rather
+* than jumped. 
+* @return void
+*/
+void ansi_present() {
+  /**
+  * Local Variables
+  * stores the end of the output, the cursor position, -1
+  * when unknown, and the cells being compared.
+  */
+  char *out;
+  int row = -1,
+      col = -1,
+      fg,
+      gap,
+      run;
+  cell *c,
+       *s;
+
+  // on the first frame or a resize, start from a cleared screen
+  if (frame_w != ansi_w || frame_h != ansi_h) {
+    ansi_w = frame_w;
+    ansi_h = frame_h;
+    ansi_shown = realloc(ansi_shown, ansi_w * ansi_h * sizeof (cell));
+    ansi_buf = realloc(ansi_buf, ansi_w * ansi_h * ANSICELL + ANSIEXTRA);
+    for (int i = 0; i < ansi_w * ansi_h; i++) {
+      ansi_shown[i].ch = ' ';
+      ansi_shown[i].attr = ATTR_NONE;
+    }
+    strcpy(ansi_buf, "\x1b[0m\x1b[2J");
+    out = ansi_buf + strlen(ansi_buf);
+    ansi_fg = -1;
+  } else
+    out = ansi_buf;
+
+  for (int y = 0; y < frame_h; y++) {
+    for (int x = 0; x < frame_w; x++) {
+      c = &frame[y * frame_w + x];
+      s = &ansi_shown[y * frame_w + x];
+      fg = palette_fg[(int) c->attr];
+      if (c->ch == s->ch && (c->ch == ' ' || fg == palette_fg[(int) s->attr]))
+        continue;
+
+      // reach the cell by writing over a short gap of unchanged
+      // cells in the current colour, or else by moving the cursor
+      gap = (y == row && x > col && x - col <= ANSIGAP) ? x - col : -1;
+      for (int i = col; gap > 0 && i < x; i++)
+        if (frame[y * frame_w + i].ch != ' ' && palette_fg[(int) frame[y * frame_w + i].attr] != ansi_fg)
+          gap = -1;
+      if (gap > 0) {
+        for (int i = col; i < x; i++)
+          *out++ = frame[y * frame_w + i].ch;
+      } else if (y == row && x != col) {
+        out = ansi_int(memcpy(out, "\x1b[", 2) + 2, x + 1);
+        *out++ = 'G';
+      } else if (y != row || x != col) {
+        out = ansi_int(memcpy(out, "\x1b[", 2) + 2, y + 1);
+        *out++ = ';';
+        out = ansi_int(out, x + 1);
+        *out++ = 'H';
+      }
+
+      // erase a long stretch of blanks in place rather than
+      // writing every space, leaving the cursor where it is
+      for (run = 0; c->ch == ' ' && x + run < frame_w && c[run].ch == ' '; run++)
+        ;
+      while (run > 0 && s[run - 1].ch == ' ')
+        run--;
+      if (run > ANSIERASE) {
+        out = ansi_int(memcpy(out, "\x1b[", 2) + 2, run);
+        *out++ = 'X';
+        for (int i = 0; i < run; i++)
+          s[i] = c[i];
+        row = y;
+        col = x;
+        x += run - 1;
+        continue;
+      }
+
+      if (c->ch != ' ' && fg != ansi_fg) {
+        out = ansi_sgr(out, fg);
+        ansi_fg = fg;
+      }
+      *out++ = c->ch;
+      *s = *c;
+      row = y;
+      col = x + 1;
+      if (col == frame_w)                                 /* the cursor is left pending a wrap */
+        row = -1;
+    }
+  }
+
+  if (out != ansi_buf)
+    ansi_write(ansi_buf, out - ansi_buf);
+}
+
+/**
+* ANSI renderer: reset the colour and have curses repaint the
+* whole screen on its next refresh. 
+* @return void
+*/
+void ansi_end() {
+  ansi_write("\x1b[0m", 4);
+  clearok(curscr, TRUE);
+}
+
+/**
+* Writes a non-negative number in decimal. 
+* @param  char     out          where to write it.
+* @param  int      n            number to write.
+* @return char                  the end of what was written.
+*/
+char *ansi_int(char *out, int n) {
+  /**
+  * Local Variables
+  * stores the digits in reverse.
+  */
+  char digits[12];
+  int len = 0;
+
+  do {
+    digits[len++] = '0' + n % 10;
+    n /= 10;
+  } while (n > 0);
+  while (len > 0)
+    *out++ = digits[--len];
+  return out;
+}
+
+/**
+* Writes the escape sequence for a foreground colour. 
+* @param  char     out          where to write it.
+* @param  int      fg           curses colour number, -1 for the default.
+* @return char                  the end of what was written.
+*/
+char *ansi_sgr(char *out, int fg) {
+  out = memcpy(out, "\x1b[", 2) + 2;
+  if (fg < 0)
+    out = ansi_int(out, 39);
+  else if (fg < 8)
+    out = ansi_int(out, 30 + fg);
+  else
+    out = ansi_int(out, 90 + fg - 8);
+  *out++ = 'm';
+  return out;
+}
+
+/**
+* Writes a buffer to the terminal, retrying if interrupted by
+* the enemy spawn alarm. 
+* @param  char     buf          bytes to write.
+* @param  size_t   len          number of bytes.
+* @return void
+*/
+void ansi_write(const char *buf, size_t len) {
+  ssize_t n;
+
+  while (len > 0) {
+    n = write(ansi_fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    buf += n;
+    len -= n;
+  }
+}
+
+/**
+* Looks up a renderer by name. 
+* @param  char     name         renderer name.
+* @return renderer              the renderer, NULL if there is none.
+*/
+renderer *find_renderer(const char *name) {
+  for (int i = 0; renderers[i] != NULL; i++)
+    if (strcmp(renderers[i]->name, name) == 0)
+      return renderers[i];
+  return NULL;
+}
+
+/**
+* Returns a random number between min and max. 
+* @param  int      min          minimum of range.
+* @param  int      max          maximum of range.
+* @return int                   a random integer between min and max.
+*/
+int my_random(int min, int max) {
+   return min + rand() / (RAND_MAX / (max - min + 1) + 1);
+}
+
+/**
+* Returns the current monotonic time. 
+* @return long long             microseconds since an arbitrary epoch.
+*/
+long long get_micros() {
+  /**
+  * Local Variables
+  * stores the monotonic clock reading.
+  */
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/**
+* Opens the telemetry file and starts the thread that drains
+* the ring into it. 
+* @param  char     path         file to write records to as CSV.
+* @return int                   0 on success, -1 otherwise.
+*/
+int telemetry_start(const char *path) {
+  /**
+  * Local Variables
+  * stores the signal mask the drain thread starts with
+  * and the one to restore afterwards.
+  */
+  sigset_t blocked,
+           previous;
+  int status;
+
+  if ((telemetry_file = fopen(path, "w")) == NULL)
+    return -1;
+  fprintf(telemetry_file, "micros,tick,friendly_bullets,enemy_bullets,num_enemies,health,"
+                          "fired,hits,spawned,frames,frame_micros,quality\n");
+  atomic_init(&telemetry.head, 0);
+  atomic_init(&telemetry.tail, 0);
+  atomic_init(&telemetry.dropped, 0);
+  atomic_init(&telemetry.running, TRUE);
+
+  // the drain thread inherits a mask with SIGALRM blocked,
+  // so the alarm is only ever handled by the game loop
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGALRM);
+  pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+  status = pthread_create(&telemetry_thread, NULL, telemetry_drain, NULL);
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+  if (status != 0) {
+    fclose(telemetry_file);
+    telemetry_file = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+* Queues a record without blocking. Only the game loop calls
+* this, so it alone moves head; when the ring is full the
+* record is counted as dropped rather than waiting on the drain.
+* @param  record   r            record to copy into the ring.
+* @return void
+*/
+void telemetry_push(record *r) {
+  unsigned head = atomic_load_explicit(&telemetry.head, memory_order_relaxed),
+           tail = atomic_load_explicit(&telemetry.tail, memory_order_acquire);
+
+  if (head - tail == RINGSIZE) {
+    atomic_fetch_add_explicit(&telemetry.dropped, 1, memory_order_relaxed);
+    return;
+  }
+  telemetry.records[head % RINGSIZE] = *r;
+  atomic_store_explicit(&telemetry.head, head + 1, memory_order_release);
+}
+
+/**
+* Background thread writing queued records to the telemetry
+* file until stopped and the ring is empty. 
+* @param  void     arg          unused.
+* @return void                  NULL.
+*/
+void *telemetry_drain(void *arg) {
+  /**
+  * Local Variables
+  * stores the ring positions, of which only tail is
+  * moved by this thread.
+  */
+  unsigned head,
+           tail;
+  record *r;
+
+  for (;;) {
+    int running = atomic_load_explicit(&telemetry.running, memory_order_acquire);
+
+    head = atomic_load_explicit(&telemetry.head, memory_order_acquire);
+    tail = atomic_load_explicit(&telemetry.tail, memory_order_relaxed);
+    for (; tail != head; tail++) {
+      r = &telemetry.records[tail % RINGSIZE];
+      fprintf(telemetry_file, "%lld,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\n",
+              r->micros, r->tick, r->friendly_bullets, r->enemy_bullets, r->num_enemies,
+              r->health, r->fired, r->hits, r->spawned, r->frames, r->frame_micros, r->quality);
+      atomic_store_explicit(&telemetry.tail, tail + 1, memory_order_release);
+    }
+    if (!running)
+      break;
+    fflush(telemetry_file);
+    usleep(DRAINDELAY);
+  }
+  return NULL;
+}
+
+/**
+* Stops the drain thread once it has written everything queued,
+* then closes the file with the number of dropped records. 
+* @return void
+*/
+void telemetry_stop() {
+  if (telemetry_file == NULL)
+    return;
+  atomic_store_explicit(&telemetry.running, FALSE, memory_order_release);
+  pthread_join(telemetry_thread, NULL);
+  fprintf(telemetry_file, "# dropped %lu\n", atomic_load(&telemetry.dropped));
+  fclose(telemetry_file);
+  telemetry_file = NULL;
+}
+
+/**
+* Starts a governor at full quality. 
+* @param  governor g            pointer to the governor.
+* @return void
+*/
+void governor_init(governor *g) {
+  g->level = QUALITY_FULL;
+  g->over = 0;
+  g->under = 0;
+  g->frame = 0;
+  g->average = 0;
+  g->changes = 0;
+}
+
+/**
+* Decides whether the current frame should be drawn. 
+* @param  governor g            pointer to the governor.
+* @param  int      ticked       > 0 if the simulation advanced this frame.
+* @return int                   > 0 if the frame should be drawn.
+*/
+int governor_render(governor *g, int ticked) {
+  g->frame++;
+  if (g->level >= QUALITY_STATIC)                         /* without interpolation only ticks change the frame */
+    return ticked;
+  if (g->level >= QUALITY_SKIP)                           /* otherwise draw every other frame */
+    return g->frame % 2 == 0;
+  return TRUE;
+}
+
+/**
+* Returns the time a drawn frame may take at a quality level,
+* which grows as the level draws fewer frames. 
+* @param  int      level        governor quality level.
+* @return long long             budget in microseconds.
+*/
+long long governor_budget(int level) {
+  if (level >= QUALITY_STATIC)
+    return (long long) FRAMESTEP * (FRAMERATE / SIMRATE);
+  if (level >= QUALITY_SKIP)
+    return (long long) FRAMESTEP * 2;
+  return FRAMESTEP;
+}
+
+/**
+* Measures a drawn frame against the budget for the current
+* level, dropping a level after DEGRADEAFTER frames over it and
+* restoring one after RESTOREAFTER frames that would have fit
+* within HEADROOM percent of the budget one level up. 
+* @param  governor g            pointer to the governor.
+* @param  long long work_micros time spent on the frame, excluding sleep.
+* @param  long long micros      time since the game started.
+* @return void
+*/
+void governor_update(governor *g, long long work_micros, long long micros) {
+  /**
+  * Local Variables
+  * stores the level before and after this frame.
+  */
+  int from = g->level,
+      to = g->level;
+
+  g->average += (work_micros - g->average) / 8;          /* smooth over roughly the last 8 frames */
+
+  if (g->average > governor_budget(from)) {
+    g->under = 0;
+    if (++g->over >= DEGRADEAFTER && to < QUALITY_BORDER)
+      to++;
+  } else if (from > QUALITY_FULL && g->average < governor_budget(from - 1) * HEADROOM / 100) {
+    g->over = 0;
+    if (++g->under >= RESTOREAFTER)
+      to--;
+  } else {
+    g->over = 0;
+    g->under = 0;
+  }
+
+  if (to == from)
+    return;
+  if (g->changes < GOVERNORLOG) {
+    g->log[g->changes].micros = micros;
+    g->log[g->changes].average = g->average;
+    g->log[g->changes].from = from;
+    g->log[g->changes].to = to;
+  }
+  g->changes++;
+  g->level = to;
+  g->over = 0;
+  g->under = 0;
+}
+
+/**
+* Prints every quality level change made during the game. 
+* @param  governor g            pointer to the governor.
+* @return void
+*/
+void governor_report(governor *g) {
+  for (int i = 0; i < g->changes && i < GOVERNORLOG; i++)
+    fprintf(stderr, "governor: %.2fs quality %d -> %d (frame %lldus, budget %lldus)\n",
+            g->log[i].micros / 1000000.0, g->log[i].from, g->log[i].to,
+            g->log[i].average, governor_budget(g->log[i].from));
+  if (g->changes > GOVERNORLOG)
+    fprintf(stderr, "governor: %d further changes not logged\n", g->changes - GOVERNORLOG);
+}
+
+/**
+* Counts an alarm for the spawn system to act on and resets
+* the alarm. Enemies are not touched here, as the handler can
+* interrupt a system part way through an archetype. 
+* @param  int      signal       the signal id number
+* @return void
+*/
+void alarm_handler(int signal) {
+  alarms++;
+
+  // reset the alarm for a random duration
+  alarm_delay = my_random(MINALRM, MAXALRM);
+  alarm(alarm_delay);
+}
+
+/**
+* Memorizes the starting time. 
+* @return void
+*/
+void start_timer() { 
+    gettimeofday(&start, NULL);
+}
+ 
+/**
+* Determines end time and computes the elapsed time. 
+* @return time the reaction time of the user in msecs.
+*/
+long stop_timer() { 
+  /**
+  * Local Variables
+  * stores time difference between end and start.
+  */
+  long time;
+
+    gettimeofday(&end, NULL);
+    time = 
+      (end.tv_sec - start.tv_sec) 
+      * 1000000 + 
+      (end.tv_usec - start.tv_usec);
+    return time;
+}
+
+/**
+* Calculates score based on time alive and enemeies destroyed. 
+* @return int         final score.
+*/
+int calculate_score(float time_alive, int enemies_destroyed) {
+  return (int) time_alive * enemies_destroyed;
+}
+
+/**
+* Checksums a log entry so torn or zeroed entries left by a
+* crash can be told apart from real games. 
+* @param  score_entry e         entry to checksum.
+* @return unsigned              FNV-1a hash of every field but the checksum.
+*/
+unsigned score_check(const score_entry *e) {
+  const unsigned char *b = (const unsigned char *) e;
+  unsigned hash = 2166136261u;
+
+  for (size_t i = 0; i < offsetof(score_entry, check); i++)
+    hash = (hash ^ b[i]) * 16777619u;
+  return hash;
+}
+
+/**
+* Returns whether key a ranks above key b: higher scores
+* first, and the earlier game first between equal scores. 
+* @param  score_key a           first key.
+* @param  score_key b           second key.
+* @return int                   > 0 if a ranks above b.
+*/
+int score_before(const score_key *a, const score_key *b) {
+  return a->score > b->score || (a->score == b->score && a->entry < b->entry);
+}
+
+/**
+* Orders keys for qsort, best first. 
+* @param  void     a            first key.
+* @param  void     b            second key.
+* @return int                   < 0 if a ranks above b.
+*/
+int score_compare(const void *a, const void *b) {
+  if (score_before(a, b))
+    return -1;
+  return score_before(b, a);
+}
+
+/**
+* Maps the log and index as they are on disk now, remapping
+* whichever has grown since it was last mapped. Must be called
+* with the index locked. 
+* @param  leaderboard b         pointer to the leaderboard.
+* @return int                   0 on success, -1 otherwise.
+*/
+int leaderboard_map(leaderboard *b) {
+  /**
+  * Local Variables
+  * stores the current size of each file.
+  */
+  struct stat log_st,
+              index_st;
+  size_t whole;
+
+  if (fstat(b->log_fd, &log_st) != 0 || fstat(b->index_fd, &index_st) != 0)
+    return -1;
+
+  // only whole entries are mapped, a torn one is left for
+  // the next writer to cut off
+  whole = log_st.st_size < (off_t) sizeof (score_log) ? 0 :
+          sizeof (score_log) + (log_st.st_size - sizeof (score_log)) / sizeof (score_entry) * sizeof (score_entry);
+  if (whole != b->log_size) {
+    if (b->log != NULL)
+      munmap(b->log, b->log_size);
+    b->log = NULL;
+    b->log_size = 0;
+    if (whole > 0 && (b->log = mmap(NULL, whole, PROT_READ, MAP_SHARED, b->log_fd, 0)) == MAP_FAILED) {
+      b->log = NULL;
+      return -1;
+    }
+    b->log_size = whole;
+  }
+  b->entries = whole == 0 ? 0 : (whole - sizeof (score_log)) / sizeof (score_entry);
+
+  if (index_st.st_size < (off_t) sizeof (score_index)) {
+    if (ftruncate(b->index_fd, sizeof (score_index)) != 0)
+      return -1;
+    index_st.st_size = sizeof (score_index);
+  }
+  if ((size_t) index_st.st_size != b->index_size) {
+    if (b->index != NULL)
+      munmap(b->index, b->index_size);
+    b->index = mmap(NULL, index_st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, b->index_fd, 0);
+    if (b->index == MAP_FAILED) {
+      b->index = NULL;
+      b->index_size = 0;
+      return -1;
+    }
+    b->index_size = index_st.st_size;
+  }
+  return 0;
+}
+
+/**
+* Brings the index up to date with the log, merging in every
+* game appended since it was last written, by this session or
+* any other. An index left dirty by a crash is rebuilt from the
+* log. Must be called with the index locked exclusively. 
+* @param  leaderboard b         pointer to the leaderboard.
+* @return int                   0 on success, -1 otherwise.
+*/
+int leaderboard_index(leaderboard *b) {
+  /**
+  * Local Variables
+  * stores the keys of the games not yet indexed.
+  */
+  score_key *fresh,
+            *keys;
+  long long count,
+            added = 0,
+            i,
+            j;
+  const score_entry *e;
+
+  if (!leaderboard_valid(b)) {
+    memset(b->index, 0, sizeof (score_index));           /* start again from an empty index */
+    memcpy(b->index->magic, INDEXMAGIC, sizeof b->index->magic);
+  }
+  if (b->index->indexed == b->entries)
+    return 0;
+
+  if ((fresh = malloc((b->entries - b->index->indexed) * sizeof (score_key))) == NULL)
+    return -1;
+  for (long long n = b->index->indexed; n < b->entries; n++) {
+    e = &b->log->entries[n];
+    if (e->check == score_check(e))
+      fresh[added++] = (score_key) { e->score, (unsigned) n };
+  }
+  qsort(fresh, added, sizeof (score_key), score_compare);
+
+  // mark the index dirty on disk before touching the keys, so
+  // a crash part way through the merge forces a rebuild
+  count = b->index->count;
+  b->index->dirty = TRUE;
+  msync(b->index, sizeof (score_index), MS_SYNC);
+  if (ftruncate(b->index_fd, sizeof (score_index) + (count + added) * sizeof (score_key)) != 0 ||
+      leaderboard_map(b) != 0) {
+    free(fresh);
+    return -1;
+  }
+
+  // merge from the back so neither run is overwritten
+  // before it has been read
+  keys = b->index->keys;
+  i = count - 1;
+  j = added - 1;
+  for (long long out = count + added - 1; j >= 0; out--) {
+    if (i >= 0 && score_before(&fresh[j], &keys[i]))
+      keys[out] = keys[i--];
+    else
+      keys[out] = fresh[j--];
+  }
+  free(fresh);
+
+  b->index->count = count + added;
+  b->index->indexed = b->entries;
+  msync(b->index, b->index_size, MS_SYNC);
+  b->index->dirty = FALSE;
+  return 0;
+}
+
+/**
+* Returns whether the mapped index can be trusted: written
+* by this game, not left dirty by a crash, and holding no
+* more keys than the log has games or the file has room for. 
+* @param  leaderboard b         pointer to the leaderboard.
+* @return int                   > 0 if the index is sound.
+*/
+int leaderboard_valid(leaderboard *b) {
+  return memcmp(b->index->magic, INDEXMAGIC, sizeof b->index->magic) == 0 && !b->index->dirty &&
+         b->index->indexed <= b->entries && b->index->count <= b->index->indexed &&
+         b->index->count <= (long long) ((b->index_size - sizeof (score_index)) / sizeof (score_key));
+}
+
+/**
+* Opens the leaderboard, creating the log and its index if
+* they do not exist yet. 
+* @param  leaderboard b         pointer to the leaderboard.
+* @param  char     path         log file, the index is kept beside it.
+* @return int                   0 on success, -1 otherwise.
+*/
+int leaderboard_open(leaderboard *b, const char *path) {
+  /**
+  * Local Variables
+  * stores the index path and the header of a new log.
+  */
+  char index_path[PATH_MAX];
+  score_log header = { LOGMAGIC, sizeof (score_entry), SCOREVERSION };
+  struct stat st;
+  int status = -1;
+
+  memset(b, 0, sizeof *b);
+  b->log_fd = b->index_fd = -1;
+  if (snprintf(index_path, sizeof index_path, "%s.idx", path) >= (int) sizeof index_path ||
+      (b->log_fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644)) < 0 ||
+      (b->index_fd = open(index_path, O_RDWR | O_CREAT, 0644)) < 0) {
+    leaderboard_close(b);
+    return -1;
+  }
+
+  flock(b->index_fd, LOCK_EX);
+  if (fstat(b->log_fd, &st) == 0 && st.st_size < (off_t) sizeof header &&
+      ftruncate(b->log_fd, 0) == 0 &&                     /* if this is a new log, give it a header */
+      write(b->log_fd, &header, sizeof header) == (ssize_t) sizeof header)
+    fdatasync(b->log_fd);
+  if (leaderboard_map(b) == 0 && b->log != NULL &&
+      memcmp(b->log, &header, sizeof header) == 0 && leaderboard_index(b) == 0) {
+    b->games = b->index->count;
+    status = 0;
+  }
+  flock(b->index_fd, LOCK_UN);
+
+  if (status != 0)
+    leaderboard_close(b);
+  return status;
+}
+
+/**
+* Appends a finished game to the log and indexes it. Sessions
+* running in parallel take turns through the index lock. 
+* @param  leaderboard b         pointer to the leaderboard.
+* @param  int      score        final score.
+* @param  int      destroyed    enemies destroyed.
+* @param  int      seconds      time alive.
+* @return long                  rank of the game, -1 if it was not recorded.
+*/
+long leaderboard_record(leaderboard *b, int score, int destroyed, int seconds) {
+  score_entry e = { time(NULL), score, destroyed, seconds, 0 };
+  long rank = -1;
+
+  e.check = score_check(&e);
+  flock(b->index_fd, LOCK_EX);
+
+  // cut off any entry torn by a crash so this one lands
+  // on an entry boundary
+  if (leaderboard_map(b) == 0 && ftruncate(b->log_fd, b->log_size) == 0 &&
+      write(b->log_fd, &e, sizeof e) == (ssize_t) sizeof e && fdatasync(b->log_fd) == 0 &&
+      leaderboard_map(b) == 0 && leaderboard_index(b) == 0) {
+    b->games = b->index->count;
+    rank = leaderboard_search(b, score) + 1;
+  }
+
+  flock(b->index_fd, LOCK_UN);
+  return rank;
+}
+
+/**
+* Counts the indexed games that scored more than a score by
+* binary search. Must be called with the index locked. 
+* @param  leaderboard b         pointer to the leaderboard.
+* @param  int      score        score to look for.
+* @return long                  games above the score.
+*/
+long leaderboard_search(leaderboard *b, int score) {
+  long lo = 0,
+       hi = b->index->count,
+       mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (b->index->keys[mid].score > score)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/**
+* Returns the rank a score would have, ties sharing a rank. 
+* @param  leaderboard b         pointer to the leaderboard.
+* @param  int      score        score to rank.
+* @return long                  rank from 1, -1 if the index is unreadable.
+*/
+long leaderboard_rank(leaderboard *b, int score) {
+  long rank = -1;
+
+  flock(b->index_fd, LOCK_SH);
+  if (leaderboard_map(b) == 0 && leaderboard_valid(b)) {
+    b->games = b->index->count;
+    rank = leaderboard_search(b, score) + 1;
+  }
+  flock(b->index_fd, LOCK_UN);
+  return rank;
+}
+
+/**
+* Copies out the best games recorded. 
+* @param  leaderboard b         pointer to the leaderboard.
+* @param  score_entry top       where to store the games, best first.
+* @param  int      n            most games to copy.
+* @return int                   number of games copied.
+*/
+int leaderboard_top(leaderboard *b, score_entry *top, int n) {
+  int copied = 0;
+
+  flock(b->index_fd, LOCK_SH);
+  if (leaderboard_map(b) == 0 && leaderboard_valid(b)) {
+    b->games = b->index->count;
+    for (; copied < n && copied < b->index->count; copied++)
+      top[copied] = b->log->entries[b->index->keys[copied].entry];
+  }
+  flock(b->index_fd, LOCK_UN);
+  return copied;
+}
+
+/**
+* Unmaps and closes the leaderboard files. 
+* @param  leaderboard b         pointer to the leaderboard.
+* @return void
+*/
+void leaderboard_close(leaderboard *b) {
+  if (b->log != NULL)
+    munmap(b->log, b->log_size);
+  if (b->index != NULL)
+    munmap(b->index, b->index_size);
+  if (b->log_fd >= 0)
+    close(b->log_fd);
+  if (b->index_fd >= 0)
+    close(b->index_fd);
+  b->log = NULL;
+  b->index = NULL;
+  b->log_fd = b->index_fd = -1;
+}
+
+void display_game_over(WINDOW *mainwin, int score, leaderboard *board, long rank) {
+  /**
+  * Local Variables
+  * stores x,y position for lettering as 
+  * well as screen dimensions.
   */
   int x,
       y;
   int max_x,
       max_y;
+  /**
+  * Local Variables
+  * stores the lines shown under the title: score,
+  * rank and the best games recorded.
+  */
+  char lines[LEADERS + 7][64] = { { 0 } };
+  score_entry top[LEADERS];
+  int n = 0,
+      leaders = 0;
+
+  snprintf(lines[n++], sizeof lines[0], "Final Score: %d", score);
+  if (board != NULL && rank > 0)                          /* if the game was recorded, show where */
+    snprintf(lines[n++], sizeof lines[0], "Rank: %ld of %lld", rank, board->games);
+  else if (board != NULL && (rank = leaderboard_rank(board, score)) > 0) /* otherwise where it would be */
+    snprintf(lines[n++], sizeof lines[0], "Would rank %ld of %lld", rank, board->games);
+  else
+    snprintf(lines[n++], sizeof lines[0], "Score not recorded.");
+  if (board != NULL && rank > 0)
+    leaders = leaderboard_top(board, top, LEADERS);
+  n++;
+  for (int i = 0; i < leaders; i++)
+    snprintf(lines[n++], sizeof lines[0], "%d. %8d  %3d kills", i + 1, top[i].score, top[i].destroyed);
+  if (leaders > 0)
+    n++;
+  snprintf(lines[n++], sizeof lines[0], "Press any key to quit.");
+  n++;
 
   getmaxyx(stdscr, max_y, max_x);
   y = max_y;
@@ -786,10 +2442,10 @@ void display_game_over(WINDOW *mainwin, int score) {
     mvprintw(y + 2, x, "|    |  ||  _  ||        ||  -__|    |   -   ||  |  ||  -__||   _|");
     mvprintw(y + 3, x, "|_______||___._||__|__|__||_____|    |_______| \\___/ |_____||__|  ");
     mvprintw(y + 4, x, "                                                                  ");
-    mvprintw(y + 6, x + 25, "Final Score: %d", score);
-    mvprintw(y + 7, x + 25, "                      ");
-    mvprintw(y + 9, x + 23, "Press any key to quit.");
-    mvprintw(y + 10, x + 23, "                      ");
+    // print score and leaderboard, each line padded to
+    // wipe out the one drawn below it last time
+    for (int i = 0; i < n; i++)
+      mvprintw(y + 6 + i, x + 19, "%-28s", lines[i]);
     y--;
 
     // update screen
@@ -800,4 +2456,127 @@ void display_game_over(WINDOW *mainwin, int score) {
   // wait for input
   sleep(4);
   getch();
-}
\ No newline at end of file
+}
+/**
+* Reads how many bytes and write calls the process has made. 
+* @param  io_usage u            where to store the counts.
+* @return void
+*/
+void read_io_usage(io_usage *u) {
+  /**
+  * Local Variables
+  * stores the kernel's accounting for this process.
+  */
+  FILE *io = fopen("/proc/self/io", "r");
+  char line[64];
+
+  u->bytes = u->writes = 0;
+  if (io == NULL)
+    return;
+  while (fgets(line, sizeof line, io) != NULL) {
+    sscanf(line, "wchar: %ld", &u->bytes);
+    sscanf(line, "syscw: %ld", &u->writes);
+  }
+  fclose(io);
+}
+
+/**
+* Plays a scripted game into an off-screen terminal and counts
+* the bytes and write calls a renderer needs for it. 
+* @param  renderer r            renderer to draw with.
+* @param  int      color        > 0 to render in colour, monochrome otherwise.
+* @param  int      batching     > 0 to let blanks join attribute runs.
+* @return io_usage              bytes and writes over BENCHFRAMES frames.
+*/
+io_usage run_benchmark(renderer *r, int color, int batching) {
+  /**
+  * Local Variables
+  * stores the off-screen terminal and what has been
+  * written before and after the game.
+  */
+  io_usage before,
+           after;
+  FILE *out = fopen("/dev/null", "w"),
+       *in = fopen("/dev/null", "r");
+  SCREEN *screen = NULL;
+  renderer *playing = backend;
+  /**
+  * Local Variables
+  * stores the scripted game state.
+  */
+  world w;
+  archetype *player = &w.types[ARCH_PLAYER],
+            *enemies = &w.types[ARCH_ENEMY],
+            *mag = &w.types[ARCH_FBULLET];
+  int max_x,
+      max_y;
+  int ticks_per_frame = FRAMERATE / SIMRATE;
+  fixed xdirection = PLANESPEEDX;
+
+  if (out == NULL || in == NULL || (ansi_fd = open("/dev/null", O_WRONLY)) < 0 ||
+      (screen = newterm("xterm-256color", out, in)) == NULL) {
+    fprintf(stderr, "Error initialising benchmark terminal.\n");
+    exit(EXIT_FAILURE);
+  }
+  resize_term(40, 120);
+  curs_set(FALSE);
+  init_palette(color);
+  frame_batching = batching;
+  srand(1);                                               /* same game for every run */
+
+  world_init(&w);
+  getmaxyx(stdscr, max_y, max_x);
+  spawn_player(&w, "      __!__   ", "----*---o---*----",
+               TO_FIXED(max_x / 2 - (PLANEWIDTH / 2)), TO_FIXED(max_y / 4));
+
+  refresh();                                              /* flush terminal setup before counting */
+  fflush(out);
+  backend = r;
+  backend->begin();
+  read_io_usage(&before);
+
+  for (int f = 0; f < BENCHFRAMES; f++) {
+    if (f % ticks_per_frame == 0) {
+      while (enemies->count < enemies->capacity)          /* keep the sky full of enemies */
+        spawn_enemy(&w, TO_FIXED(my_random(1, max_x - ENEMYWIDTH - 1)), TO_FIXED(max_y - 3));
+      if (player->health[0].hp <= 0)
+        player->health[0].hp = MAXHEALTH;
+      if (player->position[0].x + TO_FIXED(PLANEWIDTH) + xdirection >= TO_FIXED(max_x) ||
+          player->position[0].x <= xdirection)
+        xdirection = -xdirection;                         /* strafe from wall to wall... */
+      player->velocity[0].vx = xdirection;
+      if (mag->count < mag->capacity)                     /* ...firing whenever loaded */
+        player->gun[0].trigger = 1;
+      update_world(&w);
+    }
+    render_frame(&w, (f % ticks_per_frame) * FIXONE / ticks_per_frame, QUALITY_FULL);
+  }
+
+  read_io_usage(&after);
+  after.bytes -= before.bytes;
+  after.writes -= before.writes;
+
+  // clean up
+  endwin();
+  delscreen(screen);
+  fclose(out);
+  fclose(in);
+  close(ansi_fd);
+  ansi_fd = STDOUT_FILENO;
+  frame_batching = TRUE;
+  backend = playing;
+  world_free(&w);
+
+  return after;
+}
+
+/**
+* Prints one line of benchmark results. 
+* @param  char     path         what was benchmarked.
+* @param  io_usage u            bytes and writes it took.
+* @return void
+*/
+void print_benchmark(const char *path, io_usage u) {
+  printf("%-20s %9ld %9.1f %13.2f\n", path, u.bytes,
+         u.bytes / (float) BENCHFRAMES, u.writes / (float) BENCHFRAMES);
+}